@@ -17,6 +17,10 @@ void Resistance::stamp(Netlist& netlist) const {
     netlist.A(end_node,   start_node) -= admittance;
 }
 
+std::shared_ptr<Component> Resistance::clone() const {
+    return std::make_shared<Resistance>(*this);
+}
+
 
 // ReactiveComponent class methods
 /*
@@ -56,6 +60,14 @@ void Capacitor::updateVoltage(Netlist& netlist) {
     voltage = (netlist.x(start_node) - netlist.x(end_node)) + resistance * netlist.x(netlist.n + index);
 }
 
+double Capacitor::getState(const Netlist& netlist) const {
+    return netlist.x(start_node) - netlist.x(end_node);
+}
+
+std::shared_ptr<Component> Capacitor::clone() const {
+    return std::make_shared<Capacitor>(*this);
+}
+
 
 Inductance::Inductance(unsigned start_node, unsigned end_node, double value, unsigned index)
     : ReactiveComponent(start_node, end_node, value, index) {}
@@ -68,6 +80,14 @@ void Inductance::updateVoltage(Netlist& netlist) {
     voltage = -((netlist.x(start_node) - netlist.x(end_node)) + resistance * netlist.x(netlist.n + index));
 }
 
+double Inductance::getState(const Netlist& netlist) const {
+    return netlist.x(netlist.n + index);
+}
+
+std::shared_ptr<Component> Inductance::clone() const {
+    return std::make_shared<Inductance>(*this);
+}
+
 
 VoltageSource::VoltageSource(unsigned start_node, unsigned end_node, double value, unsigned index)
     : Component(start_node, end_node, value), voltage(value), index(index) {}
@@ -83,6 +103,10 @@ void VoltageSource::stamp(Netlist& netlist) const {
     netlist.b(n + index) = voltage;
 }
 
+std::shared_ptr<Component> VoltageSource::clone() const {
+    return std::make_shared<VoltageSource>(*this);
+}
+
 
 ExternalVoltageSource::ExternalVoltageSource(unsigned start_node, unsigned end_node, double value, unsigned index)
     : VoltageSource(start_node, end_node, value, index) {}
@@ -91,6 +115,10 @@ void ExternalVoltageSource::update(double new_voltage) {
     voltage = new_voltage;
 }
 
+std::shared_ptr<Component> ExternalVoltageSource::clone() const {
+    return std::make_shared<ExternalVoltageSource>(*this);
+}
+
 
 CurrentSource::CurrentSource(unsigned start_node, unsigned end_node, double value)
     : Component(start_node, end_node, value), current(value) {}
@@ -100,6 +128,10 @@ void CurrentSource::stamp(Netlist& netlist) const {
     netlist.b(end_node) += current;
 }
 
+std::shared_ptr<Component> CurrentSource::clone() const {
+    return std::make_shared<CurrentSource>(*this);
+}
+
 
 IdealOPA::IdealOPA(unsigned start_node, unsigned end_node, unsigned output_node, unsigned index)
     : Component(start_node, end_node, 0.0), output_node(output_node), index(index) {}
@@ -112,6 +144,10 @@ void IdealOPA::stamp(Netlist& netlist) const {
     netlist.A(n + index, end_node) = -1;
 }
 
+std::shared_ptr<Component> IdealOPA::clone() const {
+    return std::make_shared<IdealOPA>(*this);
+}
+
 VoltageProbe::VoltageProbe(unsigned start_node, unsigned end_node)
     : Component(start_node, end_node, 0.0) {}
 
@@ -119,6 +155,10 @@ void VoltageProbe::getVoltage(Netlist& netlist) {
     value = netlist.x(start_node) - netlist.x(end_node);
 }
 
+std::shared_ptr<Component> VoltageProbe::clone() const {
+    return std::make_shared<VoltageProbe>(*this);
+}
+
 
 Diode::Diode(unsigned start_node, unsigned end_node)
 	: Component(start_node, end_node, 0.0) {
@@ -151,6 +191,10 @@ void Diode::stamp(Netlist& netlist) const {
     netlist.b(end_node)   += Ieq;
 
 }
+
+std::shared_ptr<Component> Diode::clone() const {
+    return std::make_shared<Diode>(*this);
+}
     
 void Diode::update_voltage(Netlist& netlist) {
 	voltage = netlist.x(start_node) - netlist.x(end_node);
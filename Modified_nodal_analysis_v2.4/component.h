@@ -1,5 +1,6 @@
 //component.h
 #pragma once
+#include <memory>
 
 //Forward declaration of Netlist class to avoid circular dependencies
 class Netlist;
@@ -13,6 +14,7 @@ public:
     virtual ~Component() = default;
 
     virtual void stamp(Netlist& netlist) const = 0;
+    virtual std::shared_ptr<Component> clone() const = 0;   //deep copy, used to fork a netlist
 };
 
 class Resistance : public Component {
@@ -21,6 +23,7 @@ public:
 
     Resistance(unsigned start_node, unsigned end_node, double value);
     virtual void stamp(Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class ReactiveComponent : public Component {
@@ -32,6 +35,7 @@ public:
     ReactiveComponent(unsigned start_node, unsigned end_node, double value, unsigned index);
     virtual void setResistance(double Ts) = 0;
     virtual void updateVoltage(Netlist& netlist) = 0;
+    virtual double getState(const Netlist& netlist) const = 0;  //state variable of the component (used for error control)
     virtual void stamp(Netlist& netlist) const override;
 };
 
@@ -40,6 +44,8 @@ public:
     Capacitor(unsigned start_node, unsigned end_node, double value, unsigned index);
     virtual void setResistance(double Ts) override;
     virtual void updateVoltage(Netlist& netlist) override;
+    virtual double getState(const Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class Inductance : public ReactiveComponent {
@@ -47,6 +53,8 @@ public:
     Inductance(unsigned start_node, unsigned end_node, double value, unsigned index);
     virtual void setResistance(double Ts) override;
     virtual void updateVoltage(Netlist& netlist) override;
+    virtual double getState(const Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class VoltageSource : public Component {
@@ -56,12 +64,14 @@ public:
 
     VoltageSource(unsigned start_node, unsigned end_node, double value, unsigned index);
     virtual void stamp(Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class ExternalVoltageSource : public VoltageSource {
 public:
     ExternalVoltageSource(unsigned start_node, unsigned end_node, double value, unsigned index);
     virtual void update(double new_voltage);
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class CurrentSource : public Component {
@@ -70,6 +80,7 @@ public:
 
     CurrentSource(unsigned start_node, unsigned end_node, double value);
     virtual void stamp(Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class IdealOPA : public Component {
@@ -79,6 +90,7 @@ public:
 
     IdealOPA(unsigned start_node, unsigned end_node, unsigned output_node, unsigned index);
     virtual void stamp(Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 };
 
 class VoltageProbe : public Component {
@@ -86,6 +98,7 @@ public:
     VoltageProbe(unsigned start_node, unsigned end_node);
     //define the stamp method as something that does nothing
     virtual void stamp(Netlist& netlist) const override {};
+    virtual std::shared_ptr<Component> clone() const override;
 
     //Method to update the voltage of the probe
     void getVoltage(Netlist& netlist);
@@ -96,6 +109,7 @@ public:
     Diode(unsigned start_node, unsigned end_node);
 
 	virtual void stamp(Netlist& netlist) const override;
+    virtual std::shared_ptr<Component> clone() const override;
 
     void update_voltage(Netlist& netlist);
     void update_Id(Netlist& netlist);
@@ -5,9 +5,68 @@
 #include "lib.h"
 #include "component.h"
 #include "netlist.h"
+#include "trace.h"
 #include "chrono"
 
-int main() {
+/*
+Benchmark of the adaptive time-step mode against the fixed-step path at equal accuracy. Both are compared with a
+reference simulated at Ts / 16, with the input linearly interpolated between its samples (which is how the adaptive mode
+reads it). reltol is tightened one decade at a time until the adaptive error is no larger than the fixed-step error,
+and the computation times are compared at that point.
+The first millisecond is left out of the error, since each method starts from zero with its own first step.
+*/
+void benchmark_adaptive(const std::string& filename, const std::vector<double>& Vin, int Fs) {
+    const unsigned oversampling = 16;
+    const double Ts = 1.0 / Fs;
+
+    std::vector<double> Vin_ref((Vin.size() - 1) * oversampling + 1);
+    for (size_t i = 0; i < Vin_ref.size(); ++i) {
+        size_t idx = i / oversampling;
+        double frac = static_cast<double>(i % oversampling) / oversampling;
+        Vin_ref[i] = (idx + 1 < Vin.size()) ? Vin[idx] + frac * (Vin[idx + 1] - Vin[idx]) : Vin[idx];
+    }
+
+    Netlist netlist_ref(filename);
+    std::vector<double> Vout_ref = netlist_ref.update_system(Vin_ref, Ts / oversampling, 0, 32);
+
+    auto max_error = [&](const std::vector<double>& Vout) {
+        double error = 0;
+        for (size_t i = Fs / 1000; i < Vin.size(); ++i) {
+            error = std::max(error, std::abs(Vout[i] - Vout_ref[i * oversampling]));
+        }
+        return error;
+    };
+
+    Netlist netlist_fixed(filename);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<double> Vout_fixed = netlist_fixed.update_system(Vin, Ts, 0, 32);
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto time_fixed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    double error_fixed = max_error(Vout_fixed);
+
+    std::cout << "Fixed step:    max error " << error_fixed << " V, " << time_fixed << " us, " << Vin.size() << " steps" << std::endl;
+
+    for (double reltol = 1e-2; reltol >= 1e-11; reltol /= 10) {
+        Netlist netlist_adaptive(filename);
+        start = std::chrono::high_resolution_clock::now();
+        std::vector<double> Vout_adaptive = netlist_adaptive.update_system_adaptive(Vin, Ts, 0, reltol, reltol * 1e-3);
+        stop = std::chrono::high_resolution_clock::now();
+        auto time_adaptive = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+        double error_adaptive = max_error(Vout_adaptive);
+
+        std::cout << "Adaptive step: max error " << error_adaptive << " V, " << time_adaptive << " us, "
+                  << netlist_adaptive.acceptedSteps << " steps (reltol " << reltol << ")" << std::endl;
+
+        if (error_adaptive <= error_fixed) {
+            std::cout << "At equal accuracy the adaptive mode is " << static_cast<double>(time_fixed) / time_adaptive
+                      << "x the speed of the fixed step" << std::endl;
+            return;
+        }
+    }
+    std::cout << "The adaptive mode does not reach the fixed-step accuracy" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
 
     //std::string filename = "Netlist.txt";
 
@@ -52,6 +111,54 @@ int main() {
         outFile << std::setw(13) << std::left << Vout[i] << std::endl;
 	}
 
+    /*
+    Full-state trace: record every node voltage and branch current of a second run in a binary file,
+    then read the probed node back and compare it with the output of the simulation.
+    */
+    Netlist netlist_traced("Netlist.txt");
+
+    std::vector<double> quanta(netlist_traced.x.size(), 1e-12);        //branch currents, 1 pA
+    std::fill(quanta.begin(), quanta.begin() + netlist_traced.n, 1e-9); //node voltages, 1 nV
+
+    netlist_traced.recorder = std::make_shared<TraceRecorder>("Trace.mnat", quanta, Ts);
+    std::vector<double> Vout_traced = netlist_traced.update_system(Vin, Ts, 0, 32);
+    netlist_traced.recorder->close();
+
+    TraceReader trace("Trace.mnat");
+    std::vector<double> Vout_read = trace.getSignal(netlist_traced.voltageProbes[0]->start_node);
+
+    double max_trace_error = 0;
+    for (size_t i = 0; i < Vout_read.size(); ++i) {
+        max_trace_error = std::max(max_trace_error, std::abs(Vout_read[i] - Vout_traced[i]));
+    }
+    std::cout << "Trace: " << trace.nbrSamples << " samples of " << trace.nbrVariables << " variables, max error " << max_trace_error << " V" << std::endl;
+
+    /*
+    Adaptive time-step mode against the fixed-step path, on the signal above and on a slowly varying one
+    (2 s of a 5 Hz sine, where most of the fixed steps are wasted). The reference simulations take a few seconds,
+    so the benchmark only runs when the program is called with --benchmark.
+    */
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        benchmark_adaptive("Netlist.txt", Vin, Fs);
+
+        std::vector<double> Vin_slow = mySine(A, 5, 2.0, Fs).second;
+        for (auto& v : Vin_slow) v *= A;    //mySine returns a unit-amplitude sine
+
+        benchmark_adaptive("Netlist.txt", Vin_slow, Fs);
+    }
+
+    /*
+    Total harmonic distortion of the circuit over a grid of input levels and frequencies,
+    computed from the periodic steady state instead of simulating hundreds of periods.
+    */
+    std::vector<double> levels = { 0.1, 0.5, 1.0, 2.0 };
+    std::vector<double> frequencies = { 100, 1000, 5000 };
+    std::vector<SteadyStateResult> distortion = netlist.periodic_steady_state_sweep(levels, frequencies, Ts, 0);
+
+    for (const auto& point : distortion) {
+        std::cout << "Level: " << point.level << " V, F: " << point.frequency << " Hz, THD: " << 100 * point.thd << " %" << std::endl;
+    }
+
     return 0;
 }
 
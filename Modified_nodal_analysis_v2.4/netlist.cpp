@@ -1,7 +1,15 @@
 //netlist.cpp
 #include "Netlist.h"
 #include "component.h"
+#include "trace.h"
 #include "chrono"
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <limits>
+#include <complex>
+#include <thread>
+#include <atomic>
 
 Netlist::Netlist(const std::string& filename) {
     init(filename);
@@ -34,6 +42,10 @@ void Netlist::init(const std::string& filename) {
 
 
 void Netlist::solve_system(double Ts) {
+    //restart from a blank system, so that the simulation can be resumed (or restored) without stamping twice
+    A.setZero();
+    b.setZero();
+
     for (const auto& comp : reactiveComponents) comp->setResistance(Ts);
     for (const auto& comp : components) comp->stamp(*this);
     luDecomp.compute(A.bottomRightCorner(A.rows() - 1, A.cols() - 1));
@@ -45,101 +57,608 @@ std::vector<double> Netlist::update_system(const std::vector<double>& audio_samp
     std::cout << "A matrix:\n" << A << std::endl;
     auto start = std::chrono::high_resolution_clock::now();
     
-    //the if condition is used to check if the circuit is linear or not
-    //Far from being optimal, because if we call this function multiple times, we will have to re-stamp the system each time
-    //and to check this condition each time
+    //the if condition is used to check if the circuit is linear or not: a linear circuit is stamped and factorized once,
+    //a non-linear one is re-stamped at each Newton-Raphson iteration (see newton_solve)
     if (diodes.size()==0){ // if the circuit is linear
         solve_system(Ts);
+    }
+    else { // if the circuit includes non-linear components such as diodes
+        for (auto& comp : reactiveComponents) {
+            comp->setResistance(Ts);
+        }
+    }
+
+    for (size_t i = 0; i < audio_sample.size(); ++i) {
+        update_inputs(audio_sample[i]);
+
+        for (auto& comp : reactiveComponents) {
+            comp->updateVoltage(*this);
+        }
+
+        solve_step(imax);
+
+        //actualize the voltage value on the voltage probes
+        for (auto& voltageProbe : voltageProbes) {
+            voltageProbe->getVoltage(*this);
+        }
+
+        output[i] = voltageProbes[v_Probe_idx]->value;
+
+        if (recorder) recorder->push(x);
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << "Time: " << time << " us" << std::endl;
+
+    return output;
+}
+
+
+void Netlist::update_inputs(double input) {
+    for (auto& source : voltageSources) {
+        std::shared_ptr<ExternalVoltageSource> externalSource = std::dynamic_pointer_cast<ExternalVoltageSource>(source);
+        if (externalSource) {
+            externalSource->update(input);
+        }
+    }
+}
+
+//Newton-Raphson method, returns false if the solution did not converge within imax iterations
+bool Netlist::newton_solve(unsigned imax) {
+    for (unsigned k = 1; k < imax; k++) {
+        /*
+        Have to improve the way to update the values of the diodes,
+        since re - stamping the whole system at each iteration is not efficient.
+        In theory, we should just stamp the new values of the diodes in the A matrix and b vector.
+        Here, we are oblige to reset all the system, since the stamping operation
+        is done by a "+=" operation, and we can't just remove the contribution of the diodes
+        in the A matrix and b vector
+        */
+
+        A.setZero();
+        b.setZero();
+
+        for (auto& diode : diodes) {
+            diode->update_voltage(*this);
+            diode->update_Id(*this);
+            diode->update_Geq(*this);
+            diode->update_Ieq(*this);
+        }
+
+        for (auto& comp : components) {
+            comp->stamp(*this);
+        }
+        luDecomp.compute(A.bottomRightCorner(A.rows() - 1, A.cols() - 1));
+
+        Eigen::VectorXd x_old = x;
+        x.tail(x.size() - 1) = luDecomp.solve(b.tail(b.size() - 1));
+
+        if ((x_old.tail(x_old.size() - 1) - x.tail(x.size() - 1)).norm() < 1e-6) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//Only the companion resistances depend on the time step: update them and their diagonal entries, not the whole matrix
+void Netlist::set_time_step(double h) {
+    for (auto& comp : reactiveComponents) {
+        comp->setResistance(h);
+        A(n + comp->index, n + comp->index) = -comp->resistance;
+    }
+}
+
+/*
+Transient analysis with a variable time step, for offline simulations.
+The step is always Ts * 2^k (kmin <= k <= kmax), so that the time stays on an exact grid and, for linear circuits,
+each step size is factorized only once. The local truncation error of the trapezoidal scheme, h^3/12 * s''', is estimated
+on the state s of the reactive components (capacitor voltages, inductor currents) with the third divided difference
+of the last four accepted points. A step is rejected and halved when this error exceeds reltol * |s| + abstol
+(or when Newton-Raphson does not converge), and the step is doubled when the error is small enough.
+The input is linearly interpolated between its samples, and the output is interpolated back onto the Ts grid
+(quadratic interpolation on the last three accepted points).
+The steps do not fall on a uniform grid, so an attached recorder is not fed: traces cover fixed-step runs only.
+*/
+std::vector<double> Netlist::update_system_adaptive(const std::vector<double>& audio_sample, const double Ts, const unsigned v_Probe_idx, const double reltol, const double abstol, const unsigned imax) {
+    std::vector<double> output(audio_sample.size(), 0.0);
+    if (audio_sample.empty()) return output;
+
+    const int kmin = -6;
+    const int kmax = 6;
+    const long long unit = 1LL << -kmin;    //number of time ticks in Ts
+    const long long tEnd = static_cast<long long>(audio_sample.size() - 1) * unit;
+
+    auto input = [&](long long t) {
+        if (t <= 0) return audio_sample.front();
+        if (t >= tEnd) return audio_sample.back();
+        size_t i = static_cast<size_t>(t / unit);
+        double frac = static_cast<double>(t % unit) / unit;
+        return audio_sample[i] + frac * (audio_sample[i + 1] - audio_sample[i]);
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const bool linear = diodes.empty();
+    std::map<int, Eigen::PartialPivLU<Eigen::MatrixXd>> factorizations;
 
-        for (size_t i = 0; i < audio_sample.size(); ++i) {
-            for (auto& source : voltageSources) {
-                std::shared_ptr<ExternalVoltageSource> externalSource = std::dynamic_pointer_cast<ExternalVoltageSource>(source);
-                if (externalSource) {
-                    externalSource->update(audio_sample[i]);
+    if (linear) {
+        solve_system(Ts);
+    }
+
+    //same starting point as update_system: zero state one sample before the first output
+    long long t = -unit, t_prev = t;
+    int k = 0;
+    int kFactorized = kmax + 1;
+    double probe = 0.0, probe_prev = 0.0;
+    size_t j = 0;
+
+    Eigen::VectorXd x_prev;
+    Eigen::VectorXd state(reactiveComponents.size());
+    std::deque<std::pair<double, Eigen::VectorXd>> history;   //last accepted (time, state) pairs
+
+    acceptedSteps = 0;
+    rejectedSteps = 0;
+
+    while (j < output.size()) {
+        //do not step past the last input sample
+        while (k > kmin && t + (1LL << (k - kmin)) > tEnd) k--;
+
+        const long long hTicks = 1LL << (k - kmin);
+        const double h = Ts * hTicks / unit;
+
+        if (k != kFactorized) {
+            set_time_step(h);
+            if (linear) {
+                //factorizations are moved in and out of luDecomp, never copied: park the current one, then fetch (or compute) the new one
+                if (kFactorized <= kmax) std::swap(luDecomp, factorizations[kFactorized]);
+
+                auto it = factorizations.find(k);
+                if (it != factorizations.end()) {
+                    std::swap(luDecomp, it->second);
+                }
+                else {
+                    luDecomp.compute(A.bottomRightCorner(A.rows() - 1, A.cols() - 1));
                 }
-                source->stamp(*this);
             }
+            kFactorized = k;
+        }
+
+        //x is the whole state of the trapezoidal scheme, so a rejected step only has to restore it
+        x_prev = x;
+
+        update_inputs(input(t + hTicks));
+        for (auto& comp : reactiveComponents) {
+            comp->updateVoltage(*this);
+        }
+
+        const bool converged = solve_step(imax);
+
+        for (size_t i = 0; i < reactiveComponents.size(); ++i) {
+            state(i) = reactiveComponents[i]->getState(*this);
+        }
+
+        //ratio between the estimated local truncation error and the tolerance
+        double ratio = 0.0;
+        if (!converged) {
+            ratio = std::numeric_limits<double>::infinity();
+        }
+        else if (history.size() == 3 && !reactiveComponents.empty()) {
+            const double t0 = history[0].first, t1 = history[1].first, t2 = history[2].first, t3 = (t + hTicks) * Ts / unit;
+            const Eigen::VectorXd& s0 = history[0].second;
+            const Eigen::VectorXd& s1 = history[1].second;
+            const Eigen::VectorXd& s2 = history[2].second;
+
+            Eigen::VectorXd d10 = (s1 - s0) / (t1 - t0);
+            Eigen::VectorXd d21 = (s2 - s1) / (t2 - t1);
+            Eigen::VectorXd d32 = (state - s2) / (t3 - t2);
+            Eigen::VectorXd d3210 = ((d32 - d21) / (t3 - t1) - (d21 - d10) / (t2 - t0)) / (t3 - t0);
+
+            //s''' ~ 6 * d3210, hence LTE ~ h^3 / 2 * d3210
+            Eigen::ArrayXd lte = 0.5 * h * h * h * d3210.array().abs();
+            Eigen::ArrayXd tol = reltol * state.array().abs().max(s2.array().abs()) + abstol;
+            ratio = (lte / tol).maxCoeff();
+        }
+
+        if (ratio > 1.0 && k > kmin) {
+            x = x_prev;
+            k--;
+            rejectedSteps++;
+            continue;
+        }
+        acceptedSteps++;
+
+        for (auto& voltageProbe : voltageProbes) {
+            voltageProbe->getVoltage(*this);
+        }
+        const double probe_new = voltageProbes[v_Probe_idx]->value;
+
+        //quadratic interpolation of the probe (through the previous, current and new points) on every output sample covered by this step
+        for (; j < output.size() && static_cast<long long>(j) * unit <= t + hTicks; ++j) {
+            const double tj = static_cast<double>(static_cast<long long>(j) * unit);
+            const double t0 = static_cast<double>(t_prev), t1 = static_cast<double>(t), t2 = static_cast<double>(t + hTicks);
 
-            for (auto& comp : reactiveComponents) {
-                comp->updateVoltage(*this);
-                comp->stamp(*this);
+            if (t_prev < t) {
+                output[j] = probe_prev * (tj - t1) * (tj - t2) / ((t0 - t1) * (t0 - t2))
+                          + probe      * (tj - t0) * (tj - t2) / ((t1 - t0) * (t1 - t2))
+                          + probe_new  * (tj - t0) * (tj - t1) / ((t2 - t0) * (t2 - t1));
+            }
+            else {
+                output[j] = probe + (probe_new - probe) * (tj - t1) / (t2 - t1);
             }
+        }
+
+        t_prev = t;
+        probe_prev = probe;
+        t += hTicks;
+        probe = probe_new;
+
+        history.emplace_back(t * Ts / unit, state);
+        if (history.size() > 3) history.pop_front();
+
+        //the optimal step is h * (0.9 / ratio)^(1/3): double the step when it allows it
+        //without reactive components there is no truncation error: the step grows up to its maximum
+        if ((reactiveComponents.empty() || (history.size() == 3 && ratio * 8 < 0.9)) && k < kmax) {
+            k++;
+        }
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << "Time: " << time << " us (" << acceptedSteps << " steps, " << rejectedSteps << " rejected)" << std::endl;
 
-            x.tail(x.size() - 1) = luDecomp.solve(b.tail(b.size() - 1));
+    return output;
+}
+
+//Solve the system for the current inputs and companion voltages (for linear circuits, luDecomp has to be up to date)
+bool Netlist::solve_step(unsigned imax) {
+    if (!diodes.empty()) {
+        return newton_solve(imax);
+    }
+
+    for (auto& source : voltageSources) source->stamp(*this);
+    for (auto& comp : reactiveComponents) comp->stamp(*this);
+    x.tail(x.size() - 1) = luDecomp.solve(b.tail(b.size() - 1));
+    return true;
+}
+
+/*
+Periodic steady-state analysis by the shooting-Newton method.
+At the beginning of a period, the state of the trapezoidal scheme is the vector c of the companion voltages of the
+reactive components. One period of the fixed-step transient simulation gives c' = Phi(c), and the periodic solution
+is the root of Phi(c) - c. The sensitivity dPhi/dc is propagated along the period with the LU factorization of each
+sample, so every Newton iteration costs a single simulated period (a linear circuit converges after the first one).
+To keep F exact, the time step is Ts shortened so that a period holds an integer number N of samples, with at least
+8 samples per measured harmonic so that they stay well below Nyquist. The harmonics of the probe voltage are then
+computed with a DFT over the converged period.
+*/
+namespace {
+    //F and Ts set the number of samples per period, which has to fit in an unsigned
+    void checkSteadyStateArguments(const double level, const double F, const double Ts, const unsigned v_Probe_idx, const size_t nbrProbes) {
+        if (!std::isfinite(level)) {
+            throw std::runtime_error("Periodic steady state needs a finite level");
+        }
+        if (!(F > 0) || !(Ts > 0) || !std::isfinite(F) || !(1.0 / (F * Ts) < std::numeric_limits<unsigned>::max())) {
+            throw std::runtime_error("Periodic steady state needs a finite F > 0 and Ts > 0");
+        }
+        if (v_Probe_idx >= nbrProbes) {
+            throw std::runtime_error("No voltage probe at index " + std::to_string(v_Probe_idx));
+        }
+    }
+}
+
+SteadyStateResult Netlist::periodic_steady_state(const double level, const double F, const double Ts, const unsigned v_Probe_idx,
+                                                 const unsigned nbrHarmonics, const unsigned imax, const unsigned maxIterations) {
+    checkSteadyStateArguments(level, F, Ts, v_Probe_idx, voltageProbes.size());
+
+    const double pi = std::acos(-1.0);
+    const unsigned N = std::max({ static_cast<unsigned>(std::ceil(1.0 / (F * Ts))), 8 * nbrHarmonics, 4u });   //samples per period
+    const double h = 1.0 / (N * F);                                   //time step, h <= Ts
+    const Eigen::Index nbrStates = reactiveComponents.size();
+    const Eigen::Index size = x.size() - 1;                           //size of the system without the ground node
+
+    SteadyStateResult result;
+    result.level = level;
+    result.frequency = F;
+    result.iterations = 0;
+    result.converged = false;
+
+    std::vector<double> input(N), output(N);
+    for (unsigned i = 0; i < N; ++i) {
+        input[i] = level * std::sin(2 * pi * i / N);
+    }
+
+    //initial guess: the current state of the circuit
+    Eigen::VectorXd c(nbrStates), c_next(nbrStates);
+    for (Eigen::Index j = 0; j < nbrStates; ++j) {
+        c(j) = reactiveComponents[j]->voltage;
+    }
+
+    if (diodes.empty()) {
+        solve_system(h);
+    }
+    else {
+        for (auto& comp : reactiveComponents) comp->setResistance(h);
+    }
+
+    //updateVoltage is linear in x, its matrix dc/dx is built column by column
+    Eigen::MatrixXd dc_dx(nbrStates, size);
+    Eigen::VectorXd x_saved = x;
+    for (Eigen::Index k = 0; k < size; ++k) {
+        x.setZero();
+        x(k + 1) = 1;
+        for (Eigen::Index j = 0; j < nbrStates; ++j) {
+            reactiveComponents[j]->updateVoltage(*this);
+            dc_dx(j, k) = reactiveComponents[j]->voltage;
+        }
+    }
+    x = x_saved;
+
+    //the companion voltages are stamped in b at rows n + index
+    Eigen::MatrixXd db_dc = Eigen::MatrixXd::Zero(size, nbrStates);
+    for (Eigen::Index j = 0; j < nbrStates; ++j) {
+        db_dc(n + reactiveComponents[j]->index - 1, j) = 1;
+    }
+
+    Eigen::MatrixXd sensitivity(nbrStates, nbrStates);
+    const Eigen::MatrixXd identity = Eigen::MatrixXd::Identity(nbrStates, nbrStates);
+
+    while (result.iterations < maxIterations) {
+        result.iterations++;
+        sensitivity.setIdentity();
+        bool newtonConverged = true;
+
+        for (unsigned i = 0; i < N; ++i) {
+            update_inputs(input[i]);
+            for (Eigen::Index j = 0; j < nbrStates; ++j) {
+                if (i == 0) reactiveComponents[j]->voltage = c(j);
+                else reactiveComponents[j]->updateVoltage(*this);
+            }
+
+            newtonConverged &= solve_step(imax);
+            if (nbrStates > 0) sensitivity = dc_dx * luDecomp.solve(db_dc * sensitivity);
 
-            //actualize the voltage value on the voltage probes
             for (auto& voltageProbe : voltageProbes) {
                 voltageProbe->getVoltage(*this);
             }
-
             output[i] = voltageProbes[v_Probe_idx]->value;
         }
+
+        for (Eigen::Index j = 0; j < nbrStates; ++j) {
+            reactiveComponents[j]->updateVoltage(*this);
+            c_next(j) = reactiveComponents[j]->voltage;
+        }
+
+        //the simulated period is periodic (and every sample converged): output holds the steady-state waveform
+        Eigen::VectorXd residual = c_next - c;
+        if (newtonConverged && residual.norm() <= 1e-9 * (1 + c.norm())) {
+            result.converged = true;
+            break;
+        }
+        //without any C or L, every period is the same: there is nothing to iterate on
+        if (nbrStates == 0) break;
+
+        //Newton update: (dPhi/dc - I) * dc = -(Phi(c) - c)
+        c -= (sensitivity - identity).partialPivLu().solve(residual);
+    }
+
+    result.harmonics.assign(nbrHarmonics + 1, 0.0);
+    for (unsigned k = 0; k <= nbrHarmonics; ++k) {
+        std::complex<double> X = 0;
+        for (unsigned i = 0; i < N; ++i) {
+            X += output[i] * std::polar(1.0, -2 * pi * k * i / N);
+        }
+        result.harmonics[k] = std::abs(X) / N * (k == 0 ? 1 : 2);
     }
-    else { // if the circuit includes non-linear components such as diodes
-        for (auto& comp : reactiveComponents) {
-			comp->setResistance(Ts);
-		}
-
-        for (size_t i = 0; i < audio_sample.size(); ++i) {
-            for (auto& source : voltageSources) {
-				std::shared_ptr<ExternalVoltageSource> externalSource = std::dynamic_pointer_cast<ExternalVoltageSource>(source);
-                if (externalSource) {
-					externalSource->update(audio_sample[i]);
-				}
-			}
-
-            for (auto& comp : reactiveComponents) {
-				comp->updateVoltage(*this);
-			}
-
-            //Newton-Raphson method
-            for (unsigned k = 1; k < imax; k++) {
-                /*
-                Have to improve the way to update the values of the diodes,
-                since re - stamping the whole system at each iteration is not efficient.
-                In theory, we should just stamp the new values of the diodes in the A matrix and b vector.
-                Here, we are oblige to reset all the system, since the stamping operation
-                is done by a "+=" operation, and we can't just remove the contribution of the diodes
-                in the A matrix and b vector
-                */
-
-                A.setZero();
-                b.setZero();
-
-                for (auto& diode : diodes) {
-                    diode->update_voltage(*this);
-                    diode->update_Id(*this);
-                    diode->update_Geq(*this);
-                    diode->update_Ieq(*this);
-                }
 
-                for (auto& comp : components) {
-                    comp->stamp(*this);
-                }
-                luDecomp.compute(A.bottomRightCorner(A.rows() - 1, A.cols() - 1));
+    double distortion = 0;
+    for (unsigned k = 2; k <= nbrHarmonics; ++k) {
+        distortion += result.harmonics[k] * result.harmonics[k];
+    }
+    result.thd = (nbrHarmonics >= 1 && result.harmonics[1] > 0) ? std::sqrt(distortion) / result.harmonics[1] : 0.0;
 
-                Eigen::VectorXd x_old = x;
-                x.tail(x.size() - 1) = luDecomp.solve(b.tail(b.size() - 1));
+    return result;
+}
 
-                if ((x_old.tail(x_old.size() - 1) - x.tail(x.size() - 1)).norm() < 1e-6) {
-                    break;
-                }
-            }
+//Level/frequency grid of periodic steady-state analyses, results[l * frequencies.size() + f], computed in parallel
+std::vector<SteadyStateResult> Netlist::periodic_steady_state_sweep(const std::vector<double>& levels, const std::vector<double>& frequencies,
+                                                                    const double Ts, const unsigned v_Probe_idx, const unsigned nbrHarmonics,
+                                                                    const unsigned imax) const {
+    //an exception thrown inside a worker would terminate the program, the whole grid is checked beforehand
+    for (double level : levels) {
+        for (double F : frequencies) {
+            checkSteadyStateArguments(level, F, Ts, v_Probe_idx, voltageProbes.size());
+        }
+    }
 
-			//actualize the voltage value on the voltage probes
-            for (auto& voltageProbe : voltageProbes) {
-				voltageProbe->getVoltage(*this);
-			}   
+    std::vector<SteadyStateResult> results(levels.size() * frequencies.size());
+    std::atomic<size_t> next(0);
 
-			output[i] = voltageProbes[v_Probe_idx]->value;
-		}
-	}   
+    //every point of the grid runs on its own fork of the circuit, so all of them start from the current state
+    auto worker = [&]() {
+        for (size_t task = next++; task < results.size(); task = next++) {
+            Netlist local = fork();
+            results[task] = local.periodic_steady_state(levels[task / frequencies.size()], frequencies[task % frequencies.size()],
+                                                        Ts, v_Probe_idx, nbrHarmonics, imax);
+        }
+    };
 
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    std::cout << "Time: " << time << " us" << std::endl;
+    size_t nbrThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), results.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nbrThreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
 
-    return output;
+    return results;
+}
+
+NetlistState Netlist::snapshot() const {
+    NetlistState state;
+    state.A = A;
+    state.x = x;
+    state.b = b;
+    state.luDecomp = luDecomp;
+
+    for (const auto& comp : reactiveComponents) {
+        state.reactiveResistances.push_back(comp->resistance);
+        state.reactiveVoltages.push_back(comp->voltage);
+    }
+    for (const auto& source : voltageSources) {
+        state.sourceVoltages.push_back(source->voltage);
+    }
+    for (const auto& diode : diodes) {
+        state.diodeStates.insert(state.diodeStates.end(), { diode->voltage, diode->Id, diode->Geq, diode->Ieq });
+    }
+    return state;
+}
+
+void Netlist::restore(const NetlistState& state) {
+    if (state.x.size() != x.size() ||
+        state.b.size() != b.size() ||
+        state.A.rows() != A.rows() || state.A.cols() != A.cols() ||
+        state.reactiveResistances.size() != reactiveComponents.size() ||
+        state.reactiveVoltages.size() != reactiveComponents.size() ||
+        state.sourceVoltages.size() != voltageSources.size() ||
+        state.diodeStates.size() != 4 * diodes.size()) {
+        throw std::runtime_error("The state does not match the netlist");
+    }
+
+    A = state.A;
+    x = state.x;
+    b = state.b;
+    luDecomp = state.luDecomp;
+
+    for (size_t i = 0; i < reactiveComponents.size(); ++i) {
+        reactiveComponents[i]->resistance = state.reactiveResistances[i];
+        reactiveComponents[i]->voltage = state.reactiveVoltages[i];
+    }
+    for (size_t i = 0; i < voltageSources.size(); ++i) {
+        voltageSources[i]->voltage = state.sourceVoltages[i];
+    }
+    for (size_t i = 0; i < diodes.size(); ++i) {
+        diodes[i]->voltage = state.diodeStates[4 * i];
+        diodes[i]->Id      = state.diodeStates[4 * i + 1];
+        diodes[i]->Geq     = state.diodeStates[4 * i + 2];
+        diodes[i]->Ieq     = state.diodeStates[4 * i + 3];
+    }
+}
+
+Netlist Netlist::fork() const {
+    Netlist copy;
+
+    //components are shared_ptr, they have to be cloned for the copy to be independent
+    for (const auto& comp : components) {
+        copy.components.push_back(comp->clone());
+    }
+
+    copy.resistances        = copy.getComponents<Resistance>();
+    copy.reactiveComponents = copy.getComponents<ReactiveComponent>();
+    copy.idealOPAs          = copy.getComponents<IdealOPA>();
+    copy.voltageSources     = copy.getComponents<VoltageSource>();
+    copy.currentSources     = copy.getComponents<CurrentSource>();
+    copy.voltageProbes      = copy.getComponents<VoltageProbe>();
+    copy.diodes             = copy.getComponents<Diode>();
+
+    copy.m = m;
+    copy.n = n;
+    copy.A = A;
+    copy.x = x;
+    copy.b = b;
+    copy.luDecomp = luDecomp;
+
+    //the recorder is not shared, each branch has to be given its own trace file
+    return copy;
+}
+
+
+namespace {
+    const char stateMagic[4] = { 'M', 'N', 'A', 'S' };
+
+    void writeVector(std::ostream& os, const double* data, uint64_t size) {
+        os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        os.write(reinterpret_cast<const char*>(data), size * sizeof(double));
+    }
+
+    //number of bytes left in the stream (unbounded if the stream cannot tell)
+    uint64_t bytesLeft(std::istream& is) {
+        std::streampos pos = is.tellg();
+        if (pos == std::streampos(-1)) return std::numeric_limits<uint64_t>::max();
+
+        is.seekg(0, std::ios::end);
+        std::streampos end = is.tellg();
+        is.seekg(pos);
+        return end > pos ? static_cast<uint64_t>(end - pos) : 0;
+    }
+
+    //the length fields are checked against the stream before anything is allocated
+    uint64_t readSize(std::istream& is) {
+        uint64_t size = 0;
+        is.read(reinterpret_cast<char*>(&size), sizeof(size));
+        if (!is || size > bytesLeft(is) / sizeof(double)) {
+            throw std::runtime_error("Truncated netlist state");
+        }
+        return size;
+    }
+
+    void readVector(std::istream& is, std::vector<double>& v) {
+        v.resize(readSize(is));
+        is.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(double));
+    }
+
+    void readVector(std::istream& is, Eigen::VectorXd& v) {
+        v.resize(readSize(is));
+        is.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(double));
+    }
+}
+
+void NetlistState::save(std::ostream& os) const {
+    os.write(stateMagic, 4);
+
+    //A is square, its size is given by the size of x
+    writeVector(os, x.data(), x.size());
+    writeVector(os, b.data(), b.size());
+    os.write(reinterpret_cast<const char*>(A.data()), A.size() * sizeof(double));
+
+    writeVector(os, reactiveResistances.data(), reactiveResistances.size());
+    writeVector(os, reactiveVoltages.data(), reactiveVoltages.size());
+    writeVector(os, sourceVoltages.data(), sourceVoltages.size());
+    writeVector(os, diodeStates.data(), diodeStates.size());
+}
+
+void NetlistState::load(std::istream& is) {
+    char magic[4];
+    is.read(magic, 4);
+    if (!is || !std::equal(magic, magic + 4, stateMagic)) {
+        throw std::runtime_error("Not a netlist state");
+    }
+
+    readVector(is, x);
+    if (!is || x.size() == 0) {
+        throw std::runtime_error("Not a netlist state");
+    }
+    readVector(is, b);
+    if (b.size() != x.size()) {
+        throw std::runtime_error("Not a netlist state");
+    }
+    if (static_cast<uint64_t>(x.size()) > bytesLeft(is) / sizeof(double) / x.size()) {
+        throw std::runtime_error("Truncated netlist state");
+    }
+    A.resize(x.size(), x.size());
+    is.read(reinterpret_cast<char*>(A.data()), A.size() * sizeof(double));
+
+    readVector(is, reactiveResistances);
+    readVector(is, reactiveVoltages);
+    readVector(is, sourceVoltages);
+    readVector(is, diodeStates);
+
+    if (!is) {
+        throw std::runtime_error("Truncated netlist state");
+    }
+
+    luDecomp.compute(A.bottomRightCorner(A.rows() - 1, A.cols() - 1));
 }
 
 
@@ -20,6 +20,36 @@ class CurrentSource;
 class IdealOPA;
 class VoltageProbe;
 class Diode;
+class TraceRecorder;
+
+/*
+Everything that evolves while a circuit is simulated: the solution vector, the companion model
+of the reactive components, the operating point of the diodes, the external sources and the
+stamped/factorized system. Capturing it allows a simulation to be paused, restored or branched.
+*/
+struct NetlistState {
+    Eigen::MatrixXd A;
+    Eigen::VectorXd x, b;
+    Eigen::PartialPivLU<Eigen::MatrixXd> luDecomp;
+
+    std::vector<double> reactiveResistances;
+    std::vector<double> reactiveVoltages;
+    std::vector<double> sourceVoltages;
+    std::vector<double> diodeStates;    // voltage, Id, Geq, Ieq for each diode
+
+    void save(std::ostream& os) const;  // Binary serialization, the LU factorization is recomputed on load
+    void load(std::istream& is);
+};
+
+// Result of a periodic steady-state analysis at one level/frequency point
+struct SteadyStateResult {
+    double level;
+    double frequency;
+    std::vector<double> harmonics;      // Amplitude of the probe voltage for harmonics 0 (DC) to nbrHarmonics
+    double thd;                         // Total harmonic distortion, relative to the fundamental
+    unsigned iterations;                // Number of shooting-Newton iterations (simulated periods)
+    bool converged;
+};
 
 class Netlist {//: public std::enable_shared_from_this<Netlist> 
 public:
@@ -39,6 +69,10 @@ public:
     unsigned m; 
     unsigned n; // Number of unique nodes including the ground node (0)
 
+    unsigned acceptedSteps = 0, rejectedSteps = 0;   // Step statistics of the last adaptive simulation
+
+    std::shared_ptr<TraceRecorder> recorder; // Optional, records the full x vector at each sample (fixed-step update_system only)
+
     // Constructor
     Netlist() = default;                            // Default constructor
     explicit Netlist(const std::string& filename);  // Constructor with filename
@@ -47,6 +81,20 @@ public:
     void init(const std::string& filename);         
     void solve_system(double Ts);	
     std::vector<double> update_system(const std::vector<double>& audio_sample, const double Ts, const unsigned int v_Probe_idx, const unsigned imax);
+    std::vector<double> update_system_adaptive(const std::vector<double>& audio_sample, const double Ts, const unsigned v_Probe_idx,
+                                               const double reltol = 1e-3, const double abstol = 1e-6, const unsigned imax = 32);
+
+    // Periodic steady-state (shooting-Newton) analysis with a sine input of the given level and frequency (Ts is the largest time step used)
+    SteadyStateResult periodic_steady_state(const double level, const double F, const double Ts, const unsigned v_Probe_idx,
+                                            const unsigned nbrHarmonics = 10, const unsigned imax = 32, const unsigned maxIterations = 50);
+    std::vector<SteadyStateResult> periodic_steady_state_sweep(const std::vector<double>& levels, const std::vector<double>& frequencies,
+                                                               const double Ts, const unsigned v_Probe_idx, const unsigned nbrHarmonics = 10,
+                                                               const unsigned imax = 32) const;
+
+    // State capture, used to branch several simulations from a common checkpoint
+    NetlistState snapshot() const;
+    void restore(const NetlistState& state);
+    Netlist fork() const;                           // Independent deep copy of the circuit and of its state
 
 
     // Generic function to get components of a specific type
@@ -69,4 +117,9 @@ private:
     std::vector<std::shared_ptr<Component>> createComponentListFromTxt(const std::string& filename);
     std::shared_ptr<Component> createComponent(const std::string& netlistLine, unsigned idx);
     unsigned getNodeNbr();
+
+    void update_inputs(double input);
+    bool newton_solve(unsigned imax);
+    bool solve_step(unsigned imax);
+    void set_time_step(double h);
 };
\ No newline at end of file
@@ -0,0 +1,282 @@
+//trace.cpp
+#include "trace.h"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <limits>
+
+namespace {
+
+    const char traceMagic[4] = { 'M', 'N', 'A', 'T' };
+    const uint32_t traceVersion = 2;
+
+    //fixed-point range, the codes just above it are reserved for the non-finite values
+    const int64_t maxCode = int64_t(1) << 61;
+    const int64_t infCode = maxCode + 1;
+    const int64_t nanCode = maxCode + 2;
+
+    int64_t quantize(double value, double quantum) {
+        if (std::isnan(value)) return nanCode;
+        if (std::isinf(value)) return value > 0 ? infCode : -infCode;
+
+        double q = std::round(value / quantum);
+        if (q >  static_cast<double>(maxCode)) return  maxCode;
+        if (q < -static_cast<double>(maxCode)) return -maxCode;
+        return static_cast<int64_t>(q);
+    }
+
+    double dequantize(int64_t code, double quantum) {
+        if (code == nanCode) return std::numeric_limits<double>::quiet_NaN();
+        if (code ==  infCode) return  std::numeric_limits<double>::infinity();
+        if (code == -infCode) return -std::numeric_limits<double>::infinity();
+        return code * quantum;
+    }
+
+    template <typename T>
+    void writeRaw(std::ostream& os, const T& value) {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T readRaw(std::istream& is) {
+        T value;
+        is.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+
+    //zigzag mapping so that small negative deltas also give small unsigned values
+    uint64_t zigzag(int64_t v) {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    int64_t unzigzag(uint64_t u) {
+        return static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+    }
+
+    void writeVarint(std::vector<uint8_t>& out, uint64_t u) {
+        while (u >= 0x80) {
+            out.push_back(static_cast<uint8_t>(u | 0x80));
+            u >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(u));
+    }
+
+    uint64_t readVarint(const uint8_t*& p, const uint8_t* end) {
+        uint64_t u = 0;
+        unsigned shift = 0;
+        while (p < end) {
+            uint8_t byte = *p++;
+            u |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return u;
+            shift += 7;
+        }
+        throw std::runtime_error("Truncated trace column");
+    }
+}
+
+
+TraceRecorder::TraceRecorder(const std::string& filename, unsigned nbrVariables, double Ts,
+                             unsigned decimation, double quantum, unsigned blockSize, unsigned capacity)
+    : TraceRecorder(filename, std::vector<double>(nbrVariables, quantum), Ts, decimation, blockSize, capacity) {}
+
+TraceRecorder::TraceRecorder(const std::string& filename, const std::vector<double>& quanta, double Ts,
+                             unsigned decimation, unsigned blockSize, unsigned capacity)
+    : file(filename, std::ios::binary), nbrVariables(static_cast<unsigned>(quanta.size())), decimation(decimation > 0 ? decimation : 1),
+      decimationCounter(0), quanta(quanta), blockSize(blockSize), capacity(capacity),
+      ring(static_cast<size_t>(capacity) * nbrVariables), head(0), tail(0), running(true),
+      block(static_cast<size_t>(blockSize) * nbrVariables), blockCount(0) {
+
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open the trace file: " + filename);
+    }
+
+    file.write(traceMagic, 4);
+    writeRaw<uint32_t>(file, traceVersion);
+    writeRaw<uint32_t>(file, nbrVariables);
+    writeRaw<uint32_t>(file, blockSize);
+    writeRaw<double>(file, Ts * this->decimation);
+    file.write(reinterpret_cast<const char*>(quanta.data()), quanta.size() * sizeof(double));
+
+    writer = std::thread(&TraceRecorder::writerLoop, this);
+}
+
+TraceRecorder::~TraceRecorder() {
+    close();
+}
+
+void TraceRecorder::push(const Eigen::VectorXd& x) {
+    //once closed, there is no writer left to empty the ring
+    if (!running.load(std::memory_order_relaxed)) return;
+
+    if (x.size() != nbrVariables) {
+        throw std::runtime_error("The trace recorder was created for " + std::to_string(nbrVariables) + " variables");
+    }
+
+    if (decimationCounter++ % decimation != 0) return;
+
+    size_t h = head.load(std::memory_order_relaxed);
+
+    //the ring is full: wait for the writer rather than dropping samples
+    while (h - tail.load(std::memory_order_acquire) >= capacity) {
+        std::this_thread::yield();
+    }
+
+    std::copy(x.data(), x.data() + nbrVariables, ring.begin() + (h % capacity) * nbrVariables);
+    head.store(h + 1, std::memory_order_release);
+}
+
+void TraceRecorder::close() {
+    if (!writer.joinable()) return;
+
+    running.store(false, std::memory_order_release);
+    writer.join();
+
+    flushBlock();
+
+    uint64_t directoryOffset = static_cast<uint64_t>(file.tellp());
+    for (size_t i = 0; i < blockSamples.size(); ++i) {
+        writeRaw<uint32_t>(file, blockSamples[i]);
+        file.write(reinterpret_cast<const char*>(&columnOffsets[i * nbrVariables]), nbrVariables * sizeof(uint64_t));
+    }
+    writeRaw<uint64_t>(file, blockSamples.size());
+    writeRaw<uint64_t>(file, directoryOffset);
+    file.write(traceMagic, 4);
+    file.close();
+}
+
+void TraceRecorder::writerLoop() {
+    while (true) {
+        size_t t = tail.load(std::memory_order_relaxed);
+
+        if (t == head.load(std::memory_order_acquire)) {
+            if (!running.load(std::memory_order_acquire) && t == head.load(std::memory_order_acquire)) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        const double* slot = &ring[(t % capacity) * nbrVariables];
+        for (unsigned v = 0; v < nbrVariables; ++v) {
+            block[static_cast<size_t>(v) * blockSize + blockCount] = slot[v];
+        }
+        tail.store(t + 1, std::memory_order_release);
+
+        if (++blockCount == blockSize) {
+            flushBlock();
+        }
+    }
+}
+
+void TraceRecorder::flushBlock() {
+    if (blockCount == 0) return;
+
+    std::vector<uint8_t> column;
+    column.reserve(blockCount * 2);
+
+    blockSamples.push_back(blockCount);
+    for (unsigned v = 0; v < nbrVariables; ++v) {
+        columnOffsets.push_back(static_cast<uint64_t>(file.tellp()));
+
+        column.clear();
+        int64_t previous = 0;
+        for (unsigned i = 0; i < blockCount; ++i) {
+            int64_t q = quantize(block[static_cast<size_t>(v) * blockSize + i], quanta[v]);
+            writeVarint(column, zigzag(q - previous));
+            previous = q;
+        }
+        file.write(reinterpret_cast<const char*>(column.data()), column.size());
+    }
+    blockCount = 0;
+}
+
+
+TraceReader::TraceReader(const std::string& filename) : file(filename, std::ios::binary) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open the trace file: " + filename);
+    }
+
+    char magic[4];
+    file.read(magic, 4);
+    if (!std::equal(magic, magic + 4, traceMagic) || readRaw<uint32_t>(file) != traceVersion) {
+        throw std::runtime_error("Not a trace file: " + filename);
+    }
+    nbrVariables = readRaw<uint32_t>(file);
+    blockSize    = readRaw<uint32_t>(file);
+    Ts           = readRaw<double>(file);
+    quanta.resize(nbrVariables);
+    file.read(reinterpret_cast<char*>(quanta.data()), quanta.size() * sizeof(double));
+
+    file.seekg(-static_cast<std::streamoff>(2 * sizeof(uint64_t) + 4), std::ios::end);
+    uint64_t nbrBlocks = readRaw<uint64_t>(file);
+    directoryOffset    = readRaw<uint64_t>(file);
+    file.read(magic, 4);
+    if (!file || !std::equal(magic, magic + 4, traceMagic)) {
+        throw std::runtime_error("Trace file was not closed properly: " + filename);
+    }
+
+    blockSamples.resize(nbrBlocks);
+    columnOffsets.resize(nbrBlocks * nbrVariables);
+    nbrSamples = 0;
+
+    file.seekg(directoryOffset);
+    for (uint64_t i = 0; i < nbrBlocks; ++i) {
+        blockSamples[i] = readRaw<uint32_t>(file);
+        file.read(reinterpret_cast<char*>(&columnOffsets[i * nbrVariables]), nbrVariables * sizeof(uint64_t));
+        nbrSamples += blockSamples[i];
+    }
+}
+
+std::vector<double> TraceReader::getSignal(unsigned variable) const {
+    return getSignal(variable, 0, nbrSamples);
+}
+
+std::vector<double> TraceReader::getSignal(unsigned variable, uint64_t first, uint64_t count) const {
+    if (variable >= nbrVariables || first + count > nbrSamples) {
+        throw std::out_of_range("Trace request out of range");
+    }
+
+    std::vector<double> signal(count);
+
+    //every block but the last one holds exactly blockSize samples
+    uint64_t done = 0;
+    while (done < count) {
+        uint64_t sample = first + done;
+        uint64_t blk    = sample / blockSize;
+        uint64_t offset = sample % blockSize;
+        uint64_t n      = std::min<uint64_t>(count - done, blockSamples[blk] - offset);
+
+        decodeColumn(variable, blk, offset, n, signal.data() + done);
+        done += n;
+    }
+    return signal;
+}
+
+double TraceReader::getSample(unsigned variable, uint64_t sample) const {
+    return getSignal(variable, sample, 1)[0];
+}
+
+uint64_t TraceReader::columnEnd(uint64_t block, unsigned variable) const {
+    size_t next = block * nbrVariables + variable + 1;
+    return next < columnOffsets.size() ? columnOffsets[next] : directoryOffset;
+}
+
+void TraceReader::decodeColumn(unsigned variable, uint64_t block, uint64_t first, uint64_t count, double* out) const {
+    uint64_t begin = columnOffsets[block * nbrVariables + variable];
+    std::vector<uint8_t> bytes(columnEnd(block, variable) - begin);
+
+    file.clear();
+    file.seekg(begin);
+    file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+
+    const uint8_t* p   = bytes.data();
+    const uint8_t* end = p + bytes.size();
+
+    //deltas have to be accumulated from the beginning of the block
+    int64_t q = 0;
+    for (uint64_t i = 0; i < first + count; ++i) {
+        q += unzigzag(readVarint(p, end));
+        if (i >= first) out[i - first] = dequantize(q, quanta[variable]);
+    }
+}
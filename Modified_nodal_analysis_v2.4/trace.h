@@ -0,0 +1,94 @@
+//trace.h
+#pragma once
+#include <Eigen/Dense>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+/*
+Full-state trace recording of the MNA solution vector x (every node voltage and every branch current).
+
+The recorder is fed from the simulation loop and hands the samples to a background writer thread through
+a single-producer/single-consumer lock-free ring buffer, so the simulation only pays for one vector copy
+per recorded sample.
+
+File layout (little-endian, as written by the host):
+    header    : "MNAT" | version (u32) | nbrVariables (u32) | blockSize (u32) | Ts (f64) | quantum of each variable (f64 * nbrVariables)
+    blocks    : for each block, one compressed column per variable
+    directory : for each block, sample count (u32) + byte offset of each column (u64 * nbrVariables)
+    trailer   : nbrBlocks (u64) | directory offset (u64) | "MNAT"
+
+Each column is quantized to its own fixed-point grid (round(x / quantum)), so that node voltages and branch currents
+can use different resolutions, and stored as its first value followed by the successive differences, all zigzag + varint
+encoded. Slowly varying signals therefore cost 1 or 2 bytes per sample. Values beyond +/-2^61 quanta are saturated,
+while infinities and NaN (from a diverged Newton-Raphson step for instance) are kept as such.
+*/
+
+class TraceRecorder {
+public:
+    TraceRecorder(const std::string& filename, unsigned nbrVariables, double Ts,
+                  unsigned decimation = 1, double quantum = 1e-9,
+                  unsigned blockSize = 4096, unsigned capacity = 8192);
+    TraceRecorder(const std::string& filename, const std::vector<double>& quanta, double Ts,    //one quantum per variable
+                  unsigned decimation = 1, unsigned blockSize = 4096, unsigned capacity = 8192);
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    void push(const Eigen::VectorXd& x);    //called by the simulation thread, once per sample (no-op once closed)
+    void close();                           //flush the remaining samples and write the directory
+
+private:
+    void writerLoop();
+    void flushBlock();
+
+    std::ofstream file;
+    unsigned nbrVariables;
+    unsigned decimation;
+    unsigned decimationCounter;
+    std::vector<double> quanta;
+    unsigned blockSize;
+
+    //ring buffer shared between the simulation thread (producer) and the writer thread (consumer)
+    size_t capacity;
+    std::vector<double> ring;
+    std::atomic<size_t> head;   //next slot written by the producer
+    std::atomic<size_t> tail;   //next slot read by the consumer
+    std::atomic<bool> running;
+    std::thread writer;
+
+    //owned by the writer thread only
+    std::vector<double> block;  //column-major: block[variable * blockSize + sample]
+    unsigned blockCount;
+    std::vector<uint32_t> blockSamples;
+    std::vector<uint64_t> columnOffsets;
+};
+
+class TraceReader {
+public:
+    explicit TraceReader(const std::string& filename);
+
+    unsigned nbrVariables;
+    uint64_t nbrSamples;
+    double Ts;              //time between two recorded samples (decimation included)
+    std::vector<double> quanta;
+
+    //time series of one entry of x, either complete or on the range [first, first + count)
+    std::vector<double> getSignal(unsigned variable) const;
+    std::vector<double> getSignal(unsigned variable, uint64_t first, uint64_t count) const;
+    double getSample(unsigned variable, uint64_t sample) const;
+
+private:
+    mutable std::ifstream file;
+    unsigned blockSize;
+    uint64_t directoryOffset;
+    std::vector<uint32_t> blockSamples;
+    std::vector<uint64_t> columnOffsets;    //columnOffsets[block * nbrVariables + variable]
+
+    uint64_t columnEnd(uint64_t block, unsigned variable) const;
+    void decodeColumn(unsigned variable, uint64_t block, uint64_t first, uint64_t count, double* out) const;
+};